@@ -0,0 +1,20 @@
+echo one two three | wc -w
+echo hello world | tr a-z A-Z
+echo a b c d e f g | tr ' ' '\n' | sort | uniq | wc -l
+seq 1 50 | tail -10 | head -5 | wc -l
+echo foo bar baz | tr ' ' '\n' | sort -r | head -1
+seq 1 100 | grep 7 | wc -l
+echo the quick brown fox | tr ' ' '\n' | wc -c
+seq 1 20 | sort -n | uniq -c | tail -3 | wc -l
+echo aaa bbb ccc | tr a-c x-z | tr ' ' '\n' | sort | head -2
+seq 1 30 | grep -v 2 | sort -rn | head -4 | tail -1
+echo one two three | wc -w
+echo hello world | tr a-z A-Z
+echo a b c d e f g | tr ' ' '\n' | sort | uniq | wc -l
+seq 1 50 | tail -10 | head -5 | wc -l
+echo foo bar baz | tr ' ' '\n' | sort -r | head -1
+seq 1 100 | grep 7 | wc -l
+echo the quick brown fox | tr ' ' '\n' | wc -c
+seq 1 20 | sort -n | uniq -c | tail -3 | wc -l
+echo aaa bbb ccc | tr a-c x-z | tr ' ' '\n' | sort | head -2
+seq 1 30 | grep -v 2 | sort -rn | head -4 | tail -1
@@ -0,0 +1,19 @@
+echo alpha > /tmp/myshell-perfcheck.a
+echo beta >> /tmp/myshell-perfcheck.a
+echo gamma >> /tmp/myshell-perfcheck.a
+wc -l < /tmp/myshell-perfcheck.a
+cat /tmp/myshell-perfcheck.a | sort > /tmp/myshell-perfcheck.b
+cat /tmp/myshell-perfcheck.a /tmp/myshell-perfcheck.b > /tmp/myshell-perfcheck.c 2>&1
+grep -c a < /tmp/myshell-perfcheck.c
+ls /tmp/myshell-perfcheck.missing 2> /dev/null
+cat <<< "here string payload" | wc -c
+tr a-z A-Z <<< "more here text"
+sort /tmp/myshell-perfcheck.c | uniq > /tmp/myshell-perfcheck.b
+wc -l < /tmp/myshell-perfcheck.b
+echo alpha > /tmp/myshell-perfcheck.a
+echo beta >> /tmp/myshell-perfcheck.a
+wc -l < /tmp/myshell-perfcheck.a
+cat /tmp/myshell-perfcheck.a | sort > /tmp/myshell-perfcheck.b
+grep -c a < /tmp/myshell-perfcheck.b
+cat <<< "here string payload" | wc -c
+rm -f /tmp/myshell-perfcheck.a /tmp/myshell-perfcheck.b /tmp/myshell-perfcheck.c
@@ -0,0 +1,21 @@
+x=1; y=2; z=hello
+echo $z $x $y
+test $x -lt $y && echo lt
+test $x -eq $y || echo ne
+true && false || echo chain
+export PC_VAR=exported
+echo $PC_VAR
+pwd > /dev/null
+cd /tmp; pwd > /dev/null; cd /
+alias pe=echo
+pe aliased line
+unalias pe
+echo $z $z $z; echo $x; echo $y
+test -d /tmp && echo isdir
+test -f /nonexistent || echo nofile
+x=10; y=20
+test $x -le $y && test $y -gt $x && echo both
+echo $(echo sub)$(echo stituted)
+echo one; echo two; echo three; echo four
+true; true; true; false; true
+echo $z $x $y; test $x -lt $y && echo again
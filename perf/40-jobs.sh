@@ -0,0 +1,14 @@
+sleep 0 &
+sleep 0 &
+jobs > /dev/null
+true ;& true ;& true
+echo a | cat &
+sleep 0 &
+jobs > /dev/null
+echo p1 ;& echo p2 ;& echo p3 ;& echo p4
+sleep 0 &
+sleep 0 &
+sleep 0.01
+jobs > /dev/null
+true ;& false ;& true
+echo done
@@ -0,0 +1,211 @@
+/* Macro regression gate for myshell.  Built and run via `make perfcheck`.
+ *
+ * Runs the shell end-to-end over the committed corpus in perf/ (one
+ * script per workload: pipelines, redirections, builtin-heavy lines,
+ * background jobs) and measures, per script:
+ *
+ *   wall    wall-clock of the best of PERFCHECK_REPS runs (default 3)
+ *   maxrss  peak RSS of the shell and its children, from wait4()
+ *   spawns  external commands launched, read from the shell's own
+ *           stats segment (MYSHELL_STATS pointed at a scratch file)
+ *
+ * Results are diffed against perf/baseline: wall and maxrss may drift
+ * up to PERFCHECK_THRESH percent (default 25), spawns must not grow at
+ * all.  A missing baseline — or PERFCHECK_UPDATE=1 — rewrites it from
+ * the current run.  Exit status 1 on any regression, so the target
+ * works as a CI gate.
+ *
+ * Includes myshell.c (with main compiled out) only for the Stats layout
+ * and clock helper; the measured shell is the ./myshell binary itself.
+ */
+#define MYSHELL_NO_MAIN
+#include "myshell.c"
+#include <time.h>
+#include <sys/resource.h>
+
+#define PC_CORPUS_DIR "perf"
+#define PC_BASELINE   "perf/baseline"
+#define PC_MAX_SCRIPTS 64
+
+typedef struct {
+    char name[128];
+    double wall_ns;
+    long maxrss_kb;
+    unsigned long spawns;
+} PcResult;
+
+/* One run of ./myshell on a script: wall clock around fork..wait4, child
+ * rusage from wait4, spawn count from the stats file the child mapped. */
+static int pc_run_sb(const char *script,PcResult *r) {
+    char statsfile[256];
+    snprintf(statsfile,sizeof(statsfile),"/tmp/myshell-perfcheck-stats.%d",(int)getpid());
+    unlink(statsfile);
+    setenv("MYSHELL_STATS",statsfile,1);
+
+    long t0=stats_now_sb();
+    pid_t pid=fork();
+    if (pid < 0) { perror_continue("fork"); return -1; }
+    if (pid == 0) {
+        int devnull=open("/dev/null",O_WRONLY);
+        if (devnull >= 0) { dup2(devnull,STDOUT_FILENO); close(devnull); }
+        execl("./myshell","myshell",script,(char *)NULL);
+        fprintf(stderr,"perfcheck: exec ./myshell: %s\n",strerror(errno));
+        _exit(127);
+    }
+    int st=0;
+    struct rusage ru;
+    while (wait4(pid,&st,0,&ru) < 0 && errno == EINTR);
+    r->wall_ns=(double)(stats_now_sb() - t0);
+    r->maxrss_kb=ru.ru_maxrss;
+
+    r->spawns=0;
+    int fd=open(statsfile,O_RDONLY);
+    if (fd >= 0) {
+        Stats s;
+        if (read(fd,&s,sizeof(s)) == (ssize_t)sizeof(s) && s.magic == STATS_MAGIC)
+            r->spawns=s.stage[STAT_SPAWN].count;
+        close(fd);
+    }
+    unlink(statsfile);
+
+    if (!WIFEXITED(st) || WEXITSTATUS(st) != 0) {
+        fprintf(stderr,"perfcheck: %s: shell exited with status %d\n",
+                script,WIFEXITED(st) ? WEXITSTATUS(st) : -1);
+        return -1;
+    }
+    return 0;
+}
+
+static int pc_cmp_sb(const void *a,const void *b) {
+    return strcmp((const char *)a,(const char *)b);
+}
+
+/* Collects the .sh scripts under perf/, sorted so runs and the
+ * baseline line up. */
+static int pc_corpus_sb(char names[][128]) {
+    DIR *d=opendir(PC_CORPUS_DIR);
+    if (!d) { fprintf(stderr,"perfcheck: %s: %s\n",PC_CORPUS_DIR,strerror(errno)); return -1; }
+    int n=0;
+    struct dirent *de;
+    while ((de=readdir(d)) && n < PC_MAX_SCRIPTS) {
+        size_t len=strlen(de->d_name);
+        if (len < 4 || strcmp(de->d_name + len - 3,".sh") != 0) continue;
+        snprintf(names[n++],128,"%s",de->d_name);
+    }
+    closedir(d);
+    qsort(names,n,128,pc_cmp_sb);
+    return n;
+}
+
+static int pc_load_baseline_sb(PcResult *base,int maxn) {
+    FILE *f=fopen(PC_BASELINE,"r");
+    if (!f) return -1;
+    int n=0;
+    char line[256];
+    while (fgets(line,sizeof(line),f) && n < maxn) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        if (sscanf(line,"%127s %lf %ld %lu",base[n].name,&base[n].wall_ns,
+                   &base[n].maxrss_kb,&base[n].spawns) == 4)
+            n++;
+    }
+    fclose(f);
+    return n;
+}
+
+static void pc_write_baseline_sb(const PcResult *res,int n) {
+    FILE *f=fopen(PC_BASELINE,"w");
+    if (!f) { fprintf(stderr,"perfcheck: %s: %s\n",PC_BASELINE,strerror(errno)); exit(1); }
+    fprintf(f,"# perfcheck baseline: script wall_ns maxrss_kb spawns\n");
+    fprintf(f,"# regenerate with PERFCHECK_UPDATE=1 make perfcheck\n");
+    for (int i=0; i < n; ++i)
+        fprintf(f,"%s %.0f %ld %lu\n",res[i].name,res[i].wall_ns,
+                res[i].maxrss_kb,res[i].spawns);
+    fclose(f);
+    printf("perfcheck: baseline written to %s (%d scripts)\n",PC_BASELINE,n);
+}
+
+int main(void) {
+    /* entry-point helpers are compiled but unreachable without main */
+    (void)run_script_sb;
+    (void)history_init_sb;
+    (void)vars_load_sb;
+    (void)linedit_read_sb;
+    (void)daemon_serve_sb;
+    (void)daemon_send_sb;
+    (void)stats_init_sb;
+    (void)stats_report_sb;
+    (void)jc_init_sb;
+    (void)jobs_init_sb;
+    (void)tokenize_sb;
+    (void)parse_pipeline_sb;
+    (void)execute_single_sb;
+    (void)process_line_sb;
+    (void)run_buffer_sb;
+    (void)arena_reset_sb;
+
+    const char *s;
+    int reps=(s=getenv("PERFCHECK_REPS")) ? atoi(s) : 3;
+    double thresh=(s=getenv("PERFCHECK_THRESH")) ? atof(s) : 25.0;
+    int update=(s=getenv("PERFCHECK_UPDATE")) && atoi(s);
+    if (reps < 1) reps=1;
+
+    static char names[PC_MAX_SCRIPTS][128];
+    int nscripts=pc_corpus_sb(names);
+    if (nscripts <= 0) { fprintf(stderr,"perfcheck: no corpus scripts in %s/\n",PC_CORPUS_DIR); return 1; }
+
+    static PcResult res[PC_MAX_SCRIPTS];
+    for (int i=0; i < nscripts; ++i) {
+        char path[192];
+        snprintf(path,sizeof(path),"%s/%s",PC_CORPUS_DIR,names[i]);
+        snprintf(res[i].name,sizeof(res[i].name),"%s",names[i]);
+        res[i].wall_ns=0;
+        for (int r=0; r < reps; ++r) {
+            PcResult one;
+            if (pc_run_sb(path,&one) < 0) return 1;
+            /* best-of-N wall clock; rss and spawns are stable per run */
+            if (r == 0 || one.wall_ns < res[i].wall_ns) {
+                res[i].wall_ns=one.wall_ns;
+                res[i].maxrss_kb=one.maxrss_kb;
+                res[i].spawns=one.spawns;
+            }
+        }
+    }
+
+    static PcResult base[PC_MAX_SCRIPTS];
+    int nbase=pc_load_baseline_sb(base,PC_MAX_SCRIPTS);
+    if (nbase < 0 || update) {
+        for (int i=0; i < nscripts; ++i)
+            printf("%-20s %10.2f ms  %8ld kb  %6lu spawns\n",res[i].name,
+                   res[i].wall_ns / 1e6,res[i].maxrss_kb,res[i].spawns);
+        pc_write_baseline_sb(res,nscripts);
+        return 0;
+    }
+
+    int nfail=0;
+    printf("perfcheck: best of %d runs, threshold %.0f%%\n",reps,thresh);
+    for (int i=0; i < nscripts; ++i) {
+        PcResult *b=NULL;
+        for (int j=0; j < nbase; ++j)
+            if (strcmp(base[j].name,res[i].name) == 0) { b=&base[j]; break; }
+        if (!b) {
+            printf("%-20s %10.2f ms  %8ld kb  %6lu spawns  NEW (no baseline)\n",
+                   res[i].name,res[i].wall_ns / 1e6,res[i].maxrss_kb,res[i].spawns);
+            continue;
+        }
+        double wpct=(res[i].wall_ns - b->wall_ns) / b->wall_ns * 100.0;
+        double rpct=(double)(res[i].maxrss_kb - b->maxrss_kb) / b->maxrss_kb * 100.0;
+        int bad=wpct > thresh || rpct > thresh || res[i].spawns > b->spawns;
+        printf("%-20s %10.2f ms (%+6.1f%%)  %8ld kb (%+6.1f%%)  %6lu spawns (%+ld)%s\n",
+               res[i].name,res[i].wall_ns / 1e6,wpct,res[i].maxrss_kb,rpct,
+               res[i].spawns,(long)res[i].spawns - (long)b->spawns,
+               bad ? "  FAIL" : "");
+        if (bad) nfail++;
+    }
+    if (nfail) {
+        fflush(stdout);   /* keep the table ahead of the unbuffered summary */
+        fprintf(stderr,"perfcheck: %d regression(s); rebaseline with PERFCHECK_UPDATE=1 if intended\n",nfail);
+        return 1;
+    }
+    printf("perfcheck: ok\n");
+    return 0;
+}